@@ -3,7 +3,10 @@
 #include <stdio.h> /* fputs, fgets... */
 #include <string.h> /* String manipulation */
 #include <time.h> /* Initializing seed for random generation */
+#include <stdlib.h> /* realloc, exit... */
 /* C POSIX library, part of glibc */
+#include <fcntl.h> /* Opening folders for syncing */
+#include <pthread.h> /* Reading password files in parallel */
 #include <sys/stat.h> /* Creating folders */
 #include <termios.h> /* Telling the terminal to not show input */
 #include <unistd.h>
@@ -13,7 +16,22 @@
 #define PASS_LEN 200
 #define PATH_LEN 300
 #define RANDSTR_LEN 50
+#define SCRIPT_LINE_LEN 2048
+/* The index is a CSV file. It starts with this header line, and then has one "filename,title" line per entry,
+ * every line ending in a newline */
+#define INDEX_HEADER "Filename,Title\n"
 #define TITLE_LEN 100
+#define LOADER_THREADS 4
+/* Every encrypted file starts with the salt for the key and the nonce, followed by the ciphertext and its MAC */
+#define SEAL_HEADER_LEN (crypto_pwhash_SALTBYTES + crypto_secretbox_NONCEBYTES)
+#define SEAL_OVERHEAD (SEAL_HEADER_LEN + crypto_secretbox_MACBYTES)
+
+/* What happened when loading a password file */
+#define ENTRY_OK 0
+#define ENTRY_MISSING 1
+#define ENTRY_UNREADABLE 2
+#define ENTRY_CORRUPTED 3
+#define ENTRY_NO_MEMORY 4
 
 /* Functions */
 void show_command_information(const int sit) {
@@ -25,6 +43,8 @@ void show_command_information(const int sit) {
       fputs("ls - List all password entries\n", stdout);
       fputs("rm - Remove a password entry\n", stdout);
       fputs("get - Retrieve a password\n", stdout);
+      fputs("batch - Apply a script of add, update and rm operations all at once\n", stdout);
+      fputs("verify - Check that every password file exists and decrypts correctly\n", stdout);
       break;
     case 1:
       fputs("Invalid command, please provide a valid one.\n", stdout);
@@ -34,12 +54,17 @@ void show_command_information(const int sit) {
       fputs("ls - List all password entries\n", stdout);
       fputs("rm - Remove a password entry\n", stdout);
       fputs("get - Retrieve a password\n", stdout);
+      fputs("batch - Apply a script of add, update and rm operations all at once\n", stdout);
+      fputs("verify - Check that every password file exists and decrypts correctly\n", stdout);
       break;
     case 2:
       fputs("This command does not need arguments.\n", stdout);
       break;
     case 3:
       fputs("Too many arguments have been passed.\n", stdout);
+      break;
+    case 4:
+      fputs("This command needs the path to a batch script.\n", stdout);
   }
 }
 
@@ -108,6 +133,12 @@ off_t get_file_size(const char* path) {
   }
 
   off_t file_size = buf.st_size;
+  /* Every encrypted file starts with its salt and nonce, and ends with a MAC, so anything smaller is broken */
+  if (file_size < SEAL_OVERHEAD) {
+    fputs("File is too small to be encrypted by citpass. Aborting.\n", stdout);
+    fclose(fp);
+    exit(EXIT_FAILURE);
+  }
   /* I'll set a large upper limit for the file, 1 MB. */
   if (file_size > 1000000) {
     fputs("Index file is larger than 1 MB. Aborting.", stdout);
@@ -219,66 +250,105 @@ unsigned int get_entry_from_user(char** titles, const unsigned int lines) {
   return sel;
 }
 
-int encrypt(const char* dest_file_path, const char* message, const size_t message_len) {
-  unsigned char salt[crypto_pwhash_SALTBYTES] = {0};
+/* Deriving a key from an already entered master password and sealing message into dest_file_path. The salt used for
+ * deriving the key and the nonce used for encrypting are both random, and written at the start of the file, since
+ * the same ones are needed for decrypting it later. When sync is set, the file's contents are flushed all the way
+ * to disk before returning. Returns -1 if the file can't be written */
+int seal_file(const char* dest_file_path, const char* message, const size_t message_len, const char* mast_pass, const int sync) {
   unsigned char key[crypto_secretbox_KEYBYTES] = {0};
-  char mast_pass[PASS_LEN] = {0};
+  /* sealed holds the salt, then the nonce, then the actual ciphertext with its MAC */
+  unsigned char sealed[message_len + SEAL_OVERHEAD];
+  unsigned char* salt = sealed;
+  unsigned char* nonce = sealed + crypto_pwhash_SALTBYTES;
 
-  fputs("Master password: ", stdout);
-  password_input(mast_pass, PASS_LEN);
-  fputs("\n", stdout);
-  /* Salt generation */
-  randombytes_buf(salt, sizeof(salt));
+  /* Salt and nonce generation */
+  randombytes_buf(salt, crypto_pwhash_SALTBYTES);
+  randombytes_buf(nonce, crypto_secretbox_NONCEBYTES);
   /* Key generation from password */
   if (crypto_pwhash(key, sizeof(key), mast_pass, strlen(mast_pass), salt, crypto_pwhash_OPSLIMIT_MODERATE, crypto_pwhash_MEMLIMIT_MODERATE, crypto_pwhash_ALG_DEFAULT) != 0) {
     fputs("Ran out of memory while deriving key from master password. Aborting.\n", stdout);
     exit(EXIT_FAILURE);
   }
   /* Actual encryption */
-  unsigned char ciphertext[message_len + crypto_secretbox_MACBYTES];
-  crypto_secretbox_easy(ciphertext, (unsigned char*)message, message_len, salt, key);
+  crypto_secretbox_easy(sealed + SEAL_HEADER_LEN, (unsigned char*)message, message_len, nonce, key);
+  sodium_memzero(key, sizeof(key));
   /* Writing encrypted contents into file */
   FILE* dest_fp = fopen(dest_file_path, "wb");
   if (! dest_fp) {
-    fputs("Failed to open file. Aborting.\n", stdout);
-    exit(EXIT_FAILURE);
+    return -1;
+  }
+  if (fwrite(sealed, 1, message_len + SEAL_OVERHEAD, dest_fp) != message_len + SEAL_OVERHEAD) {
+    fclose(dest_fp);
+    return -1;
+  }
+  if (sync && (fflush(dest_fp) != 0 || fsync(fileno(dest_fp)) != 0)) {
+    fclose(dest_fp);
+    return -1;
+  }
+  if (fclose(dest_fp) != 0) {
+    return -1;
   }
-  fwrite(ciphertext, 1, message_len + crypto_secretbox_MACBYTES, dest_fp);
-  fclose(dest_fp);
   return 0;
 }
 
-/* File decryption is always failing because a different salt is used every time */
-int decrypt(const char* src_file_path, const char* message, const size_t message_len) {
-  unsigned char salt[crypto_pwhash_SALTBYTES] = {0};
-  unsigned char key[crypto_secretbox_KEYBYTES] = {0};
+int encrypt(const char* dest_file_path, const char* message, const size_t message_len) {
   char mast_pass[PASS_LEN] = {0};
 
   fputs("Master password: ", stdout);
   password_input(mast_pass, PASS_LEN);
   fputs("\n", stdout);
-  /* Salt generation */
-  randombytes_buf(salt, sizeof(salt));
+  if (seal_file(dest_file_path, message, message_len, mast_pass, 0) != 0) {
+    fputs("Failed to write file. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
+  sodium_memzero(mast_pass, sizeof(mast_pass));
+  return 0;
+}
+
+/* Same as seal_file(), the other way around, on the contents of a sealed file that's already in memory. The salt
+ * and nonce are taken from the start of sealed. Returns -1 if the ciphertext doesn't authenticate, and -2 if there
+ * isn't enough memory for deriving the key. It never exits, since it also runs on the loader's threads */
+int unseal_buf(const unsigned char* sealed, const size_t message_len, const char* message, const char* mast_pass) {
+  unsigned char key[crypto_secretbox_KEYBYTES] = {0};
+  const unsigned char* salt = sealed;
+  const unsigned char* nonce = sealed + crypto_pwhash_SALTBYTES;
+
   /* Key generation */
   if (crypto_pwhash(key, sizeof(key), mast_pass, strlen(mast_pass), salt, crypto_pwhash_OPSLIMIT_MODERATE, crypto_pwhash_MEMLIMIT_MODERATE, crypto_pwhash_ALG_DEFAULT) != 0) {
-    fputs("Ran out of memory while deriving key from master password. Aborting.\n", stdout);
-    exit(EXIT_FAILURE);
+    return -2;
   }
+  /* Decryption */
+  int ret = crypto_secretbox_open_easy((unsigned char*)message, sealed + SEAL_HEADER_LEN, message_len + crypto_secretbox_MACBYTES, nonce, key);
+  sodium_memzero(key, sizeof(key));
+  return ret != 0 ? -1 : 0;
+}
+
+/* Reading a sealed file and decrypting it into message. Returns -1 if the file can't be read or doesn't
+ * authenticate, leaving it to the caller to say what failed to decrypt */
+int unseal_file(const char* src_file_path, const char* message, const size_t message_len, const char* mast_pass) {
   /* Reading encrypted file */
   FILE* dest_fp = fopen(src_file_path, "rb");
   if (! dest_fp) {
-    fputs("Failed to open file. Aborting.\n", stdout);
-    exit(EXIT_FAILURE);
-  }
-  unsigned char ciphertext[message_len + crypto_secretbox_MACBYTES];
-  fread(ciphertext, sizeof(char), message_len + crypto_secretbox_MACBYTES, dest_fp);
-  /* Decryption */
-  if (crypto_secretbox_open_easy((unsigned char*)message, ciphertext, message_len + crypto_secretbox_MACBYTES, salt, key) != 0) {
-    fputs("File contents have been forged or corrupted. Aborting.\n", stdout);
-    exit(EXIT_FAILURE);
+    return -1;
   }
+  unsigned char sealed[message_len + SEAL_OVERHEAD];
+  size_t got = fread(sealed, sizeof(char), message_len + SEAL_OVERHEAD, dest_fp);
   fclose(dest_fp);
-  return 0;
+  if (got != message_len + SEAL_OVERHEAD) {
+    return -1;
+  }
+  return unseal_buf(sealed, message_len, message, mast_pass);
+}
+
+int decrypt(const char* src_file_path, const char* message, const size_t message_len) {
+  char mast_pass[PASS_LEN] = {0};
+
+  fputs("Master password: ", stdout);
+  password_input(mast_pass, PASS_LEN);
+  fputs("\n", stdout);
+  int ret = unseal_file(src_file_path, message, message_len, mast_pass);
+  sodium_memzero(mast_pass, sizeof(mast_pass));
+  return ret;
 }
 
 void initialize(const char* dir_path, const char* index_path) {
@@ -293,7 +363,7 @@ void initialize(const char* dir_path, const char* index_path) {
     }
     else {
       fputs("Creating index file within folder.\n", stdout);
-      if (encrypt(index_path, "Filename,Title", strlen("Filename,Title")) != 0) {
+      if (encrypt(index_path, INDEX_HEADER, strlen(INDEX_HEADER)) != 0) {
         fputs("Failed to encrypt index file. Aborting.\n", stdout);
         exit(EXIT_FAILURE);
       }
@@ -309,7 +379,7 @@ void initialize(const char* dir_path, const char* index_path) {
     }
     else {
       fputs("Creating index file within folder.\n", stdout);
-      if (encrypt(index_path, "Filename,Title", strlen("Filename,Title")) != 0) {
+      if (encrypt(index_path, INDEX_HEADER, strlen(INDEX_HEADER)) != 0) {
         fputs("Failed to encrypt index file. Aborting.\n", stdout);
         exit(EXIT_FAILURE);
       }
@@ -317,14 +387,41 @@ void initialize(const char* dir_path, const char* index_path) {
   }
 }
 
+/* Removing the newline fgets() leaves at the end of a string, if there's one */
+void strip_newline(char* str) {
+  size_t len = strlen(str);
+  if (len > 0 && str[len - 1] == '\n') {
+    str[len - 1] = '\0';
+  }
+}
+
+/* Putting together the contents of a password file, one field per line. The result is allocated on the heap,
+ * and entry_len is set to its length, counting the null byte at the end, which is encrypted along with it */
+char* format_entry(const char* title, const char* password, const char* username, const char* url, const char* notes, size_t* entry_len) {
+  /* 4 new line characters between the 5 fields, and the null byte */
+  *entry_len = strlen(title) + strlen(password) + strlen(username) + strlen(url) + strlen(notes) + 5;
+  char* entry = calloc(*entry_len, sizeof(char));
+  if (! entry) {
+    fputs("Failed to allocate needed memory for password entry. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
+  snprintf(entry, *entry_len, "%s\n%s\n%s\n%s\n%s", title, password, username, url, notes);
+  return entry;
+}
+
 /* Adding a password to the folder, and adding the random filename to the index */
 void add_password(const char* index_path, char* file_path) {
   char rand_str[RANDSTR_LEN] = {0};
   /* We initialize the seed for generating random strings. Now, this might be a shitty way to get a seed, but all
    * I want is some junk to put as a filename, it's not a mission critical task */
   srand(time(0));
-  rand_junk_str(rand_str, RANDSTR_LEN);
-  snprintf(file_path + strlen(file_path), PATH_LEN - strlen(file_path), "%s", rand_str);
+  /* Since the seed only changes every second, another entry might already have the name we get, so we keep
+   * drawing names until there's no file by that name */
+  size_t dir_len = strlen(file_path);
+  do {
+    rand_junk_str(rand_str, RANDSTR_LEN);
+    snprintf(file_path + dir_len, PATH_LEN - dir_len, "%s", rand_str);
+  } while (access(file_path, F_OK) != -1);
 
   char title[TITLE_LEN] = {0};
   char password[PASS_LEN] = {0};
@@ -334,6 +431,12 @@ void add_password(const char* index_path, char* file_path) {
 
   fputs("Title: ", stdout);
   fgets(title, TITLE_LEN, stdin);
+  strip_newline(title);
+  /* An entry without a title couldn't be picked from the index later on, and check_index() would refuse it */
+  if (strlen(title) == 0) {
+    fputs("The title can't be empty. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
 
   fputs("Password: ", stdout);
   password_input(password, PASS_LEN);
@@ -348,34 +451,42 @@ void add_password(const char* index_path, char* file_path) {
   fputs("Notes: ", stdout);
   fgets(notes, 1000, stdin);
 
-  /* strlen() excludes the null byte, but strcat() includes it, so when allocating the entire
-   * entry on the stack, we need to take that into account. We need 5 extra elements for the
-   * null bytes at the end, and 4 new line characters. */
-  unsigned int entry_len = strlen(title) + strlen(password) + strlen(username) + strlen(url) + strlen(notes) + 9;
-  char entry[entry_len];
-  /* snprintf() however does include the null byte, even when writing entry_len characters to entry */
-  snprintf(entry, entry_len, "%s%s%s%s%s%s%s%s%s", title, "\n", password, "\n", username, "\n", url, "\n", notes);
+  strip_newline(password);
+  strip_newline(username);
+  strip_newline(url);
+  strip_newline(notes);
+
+  size_t entry_len = 0;
+  char* entry = format_entry(title, password, username, url, notes, &entry_len);
   if (encrypt(file_path, entry, entry_len) != 0) {
     fputs("Unable to encrypt password file. Aborting.\n", stdout);
     exit(EXIT_FAILURE);
   }
-  /* Now, we append the title of the entry and corresponding randomized filename to the end of the index file */
-  size_t index_len = ((size_t)get_file_size(index_path) - crypto_secretbox_MACBYTES)/sizeof(char);
-  char* index_buf = calloc(index_len + RANDSTR_LEN + strlen(title) + 1, sizeof(char));
+  sodium_memzero(entry, entry_len);
+  free(entry);
+  /* Now, we append the randomized filename and the title of the entry, as a new line, to the end of the index file */
+  size_t index_len = ((size_t)get_file_size(index_path) - SEAL_OVERHEAD)/sizeof(char);
+  size_t line_len = strlen(rand_str) + 1 + strlen(title) + 1;
+  char* index_buf = calloc(index_len + line_len + 1, sizeof(char));
+  if (! index_buf) {
+    fputs("Failed to allocate needed memory for reading index file. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
   if (decrypt(index_path, index_buf, index_len) != 0) {
     fputs("Unable to decrypt index file. Aborting.\n", stdout);
     exit(EXIT_FAILURE);
   }
-  snprintf(index_buf + index_len, RANDSTR_LEN + 1 + strlen(title), "%s%s%s", rand_str, ",", title);
-  /* Append index_entry to index_buf, overwrite index_path with encrypt() */
-  if (encrypt(index_path, index_buf, index_len + RANDSTR_LEN + strlen(title) + 1) != 0) {
+  snprintf(index_buf + index_len, line_len + 1, "%s,%s\n", rand_str, title);
+  /* Overwrite index_path with encrypt(). The null byte snprintf() leaves at the end isn't part of the index */
+  if (encrypt(index_path, index_buf, index_len + line_len) != 0) {
     fputs("Unable to encrypt index file. Aborting.\n", stdout);
     exit(EXIT_FAILURE);
   }
+  free(index_buf);
 }
 
 void list_passwords(const char* index_path) {
-  size_t index_len = ((size_t)get_file_size(index_path) - crypto_secretbox_MACBYTES)/sizeof(char);
+  size_t index_len = ((size_t)get_file_size(index_path) - SEAL_OVERHEAD)/sizeof(char);
   char* index_buf = calloc(index_len, sizeof(char));
 
   if (! index_buf) {
@@ -393,7 +504,7 @@ void list_passwords(const char* index_path) {
     }
   }
   /* We allocate the first "column", of the 2D char array, */
-  char** titles = calloc(lines, sizeof(char));
+  char** titles = calloc(lines, sizeof(char*));
   if (! titles) {
     fputs("Failed to allocate needed memory for reading index file. Aborting.\n", stdout);
     free(titles);
@@ -423,7 +534,7 @@ void list_passwords(const char* index_path) {
 }
 
 void rm_password(const char* index_path, char* file_path) {
-  size_t index_len = ((size_t)get_file_size(index_path) - crypto_secretbox_MACBYTES)/sizeof(char);
+  size_t index_len = ((size_t)get_file_size(index_path) - SEAL_OVERHEAD)/sizeof(char);
   char* index_buf = calloc(index_len, sizeof(char));
 
   if (! index_buf) {
@@ -441,7 +552,7 @@ void rm_password(const char* index_path, char* file_path) {
     }
   }
   /* Now we allocate memory for the entry titles */
-  char** titles = calloc(lines, sizeof(char));
+  char** titles = calloc(lines, sizeof(char*));
   if (! titles) {
     fputs("Failed to allocate needed memory for reading index file. Aborting.\n", stdout);
     free(titles);
@@ -469,7 +580,7 @@ void rm_password(const char* index_path, char* file_path) {
   unsigned int sel = get_entry_from_user(titles, lines);
   free(titles);
   /* Same thing as we did with titles, we do with the randomized filenames */
-  char** filenames = calloc(lines, sizeof(char));
+  char** filenames = calloc(lines, sizeof(char*));
   if (! filenames) {
     fputs("Failed to allocate needed memory for reading index file. Aborting.\n", stdout);
     free(filenames);
@@ -517,7 +628,7 @@ void rm_password(const char* index_path, char* file_path) {
 }
 
 void get_password(const char* index_path, char* file_path) {
-  size_t index_len = ((size_t)get_file_size(index_path) - crypto_secretbox_MACBYTES)/sizeof(char);
+  size_t index_len = ((size_t)get_file_size(index_path) - SEAL_OVERHEAD)/sizeof(char);
   char* index_buf = calloc(index_len, sizeof(char));
   if (! index_buf) {
     fputs("Failed to allocate needed memory for reading index file. Aborting.", stdout);
@@ -534,7 +645,7 @@ void get_password(const char* index_path, char* file_path) {
     }
   }
   /* Allocating memory on the heap for password entry titles */
-  char** titles = calloc(lines, sizeof(char));
+  char** titles = calloc(lines, sizeof(char*));
   if (! titles) {
     fputs("Failed to allocate needed memory for reading index file. Aborting.\n", stdout);
     free(titles);
@@ -562,7 +673,7 @@ void get_password(const char* index_path, char* file_path) {
   for (int m = lines - 1; m >= 0; m--) free(titles[m]);
   free(titles);
   /* Allocating memory on the heap for randomized filenames */
-  char** filenames = calloc(lines, sizeof(char));
+  char** filenames = calloc(lines, sizeof(char*));
   if (! filenames) {
     fputs("Failed to allocate needed memory for reading index file. Aborting.\n", stdout);
     free(filenames);
@@ -585,7 +696,7 @@ void get_password(const char* index_path, char* file_path) {
   /* And concatenate the right filename to file_path, so now we can actually decrypt the right file */
   snprintf(file_path + strlen(file_path), PATH_LEN - strlen(file_path), "%s", filenames[sel]);
   /* Password file decryption */
-  size_t file_len = ((size_t)get_file_size(file_path) - crypto_secretbox_MACBYTES)/sizeof(char);
+  size_t file_len = ((size_t)get_file_size(file_path) - SEAL_OVERHEAD)/sizeof(char);
   char* file_buf = calloc(file_len, sizeof(char));
   if (decrypt(file_path, file_buf, file_len) != 0) {
     fputs("Unable to decrypt password file. Aborting.\n", stdout);
@@ -598,6 +709,565 @@ void get_password(const char* index_path, char* file_path) {
   free(file_buf);
 }
 
+/* Flushing a directory's entries to disk, so that files created or renamed within it survive a crash */
+int sync_dir(const char* dir_path) {
+  int fd = open(dir_path, O_RDONLY);
+  if (fd == -1) {
+    return -1;
+  }
+  int ret = fsync(fd);
+  close(fd);
+  return ret;
+}
+
+/* strdup(), but aborting when there's no memory left, like everywhere else */
+char* dup_str(const char* str) {
+  char* copy = strdup(str);
+  if (! copy) {
+    fputs("Failed to allocate needed memory for batch. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
+  return copy;
+}
+
+/* Making sure a heap array of strings has room for one more string, doubling it when it doesn't */
+char** reserve_str_array(char** arr, const unsigned int count, unsigned int* cap) {
+  if (count < *cap) {
+    return arr;
+  }
+  unsigned int new_cap = *cap ? *cap * 2 : 16;
+  char** new_arr = realloc(arr, new_cap * sizeof(char*));
+  if (! new_arr) {
+    fputs("Failed to allocate needed memory for batch. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
+  *cap = new_cap;
+  return new_arr;
+}
+
+/* Returns the position of str within arr, or -1 if it isn't there */
+int find_str(char** arr, const unsigned int count, const char* str) {
+  for (unsigned int n = 0; n < count; n++) {
+    if (arr[n] && strcmp(arr[n], str) == 0) {
+      return (int)n;
+    }
+  }
+  return -1;
+}
+
+/* Making sure a decrypted index is made of nothing but the header and "filename,title" lines, each ending in a
+ * newline. Anything else, like a null byte or a missing newline, would make split_index() silently skip
+ * entries. Returns -1 if the index isn't well formed */
+int check_index(const char* index_buf, const size_t index_len) {
+  size_t header_len = strlen(INDEX_HEADER);
+  if (index_len < header_len || memcmp(index_buf, INDEX_HEADER, header_len) != 0) {
+    return -1;
+  }
+  if (memchr(index_buf, '\0', index_len) || index_buf[index_len - 1] != '\n') {
+    return -1;
+  }
+  size_t n = header_len;
+  while (n < index_len) {
+    const char* line = index_buf + n;
+    size_t line_len = (size_t)((const char*)memchr(line, '\n', index_len - n) - line);
+    const char* comma = memchr(line, ',', line_len);
+    if (! comma) {
+      return -1;
+    }
+    size_t filename_len = (size_t)(comma - line);
+    size_t title_len = line_len - filename_len - 1;
+    if (filename_len == 0 || filename_len >= RANDSTR_LEN || title_len == 0 || title_len >= TITLE_LEN) {
+      return -1;
+    }
+    n += line_len + 1;
+  }
+  return 0;
+}
+
+/* Splitting a decrypted index into titles and filenames, skipping the "Filename,Title" header line. Unlike the
+ * parsers above, the arrays only hold actual entries, so there's nothing to compensate for. index_buf is cut
+ * up in the process, and should have gone through check_index() first. Returns how many entries there are */
+unsigned int split_index(char* index_buf, char*** titles, char*** filenames, unsigned int* titles_cap, unsigned int* filenames_cap) {
+  unsigned int entries = 0;
+  char* line = strchr(index_buf, '\n');
+  while (line) {
+    line++;
+    char* end = strchr(line, '\n');
+    if (end) {
+      *end = '\0';
+    }
+    char* comma = strchr(line, ',');
+    if (comma) {
+      *comma = '\0';
+      *titles = reserve_str_array(*titles, entries, titles_cap);
+      *filenames = reserve_str_array(*filenames, entries, filenames_cap);
+      (*titles)[entries] = dup_str(comma + 1);
+      (*filenames)[entries] = dup_str(line);
+      entries++;
+    }
+    line = end;
+  }
+  return entries;
+}
+
+/* Reading a password file in one go and decrypting it in memory. On success, *body points to the
+ * null terminated contents, which the caller has to free */
+int load_entry(const char* file_path, const char* filename, const char* mast_pass, char** body) {
+  char entry_path[PATH_LEN] = {0};
+  snprintf(entry_path, PATH_LEN, "%s%s", file_path, filename);
+  int fd = open(entry_path, O_RDONLY);
+  if (fd == -1) {
+    return ENTRY_MISSING;
+  }
+  /* Same sanity checks as in get_file_size() */
+  struct stat buf;
+  if (fstat(fd, &buf) != 0 || ! S_ISREG(buf.st_mode) || buf.st_size < SEAL_OVERHEAD || buf.st_size > 1000000) {
+    close(fd);
+    return ENTRY_UNREADABLE;
+  }
+  size_t file_size = (size_t)buf.st_size;
+  unsigned char* sealed = malloc(file_size);
+  if (! sealed) {
+    close(fd);
+    return ENTRY_UNREADABLE;
+  }
+  size_t done = 0;
+  while (done < file_size) {
+    ssize_t got = read(fd, sealed + done, file_size - done);
+    if (got <= 0) {
+      break;
+    }
+    done += (size_t)got;
+  }
+  close(fd);
+  if (done != file_size) {
+    free(sealed);
+    return ENTRY_UNREADABLE;
+  }
+  size_t message_len = file_size - SEAL_OVERHEAD;
+  char* message = calloc(message_len + 1, sizeof(char));
+  if (! message) {
+    free(sealed);
+    return ENTRY_UNREADABLE;
+  }
+  int ret = unseal_buf(sealed, message_len, message, mast_pass);
+  free(sealed);
+  if (ret != 0) {
+    free(message);
+    return ret == -2 ? ENTRY_NO_MEMORY : ENTRY_CORRUPTED;
+  }
+  *body = message;
+  return ENTRY_OK;
+}
+
+/* What the loader's threads share. Each thread takes the next filename that nobody has taken yet */
+struct entry_loader {
+  const char* file_path;
+  char** filenames;
+  const char* mast_pass;
+  char** bodies;
+  int* status;
+  unsigned int count;
+  unsigned int next;
+  pthread_mutex_t lock;
+};
+
+void* load_entries_worker(void* arg) {
+  struct entry_loader* loader = arg;
+  for (;;) {
+    pthread_mutex_lock(&loader->lock);
+    unsigned int n = loader->next;
+    if (n < loader->count) {
+      loader->next++;
+    }
+    pthread_mutex_unlock(&loader->lock);
+    if (n >= loader->count) {
+      break;
+    }
+    loader->status[n] = load_entry(loader->file_path, loader->filenames[n], loader->mast_pass, &loader->bodies[n]);
+  }
+  return NULL;
+}
+
+/* Reading and decrypting every password file in filenames[] for whole vault operations. Every file is sealed
+ * with its own key derivation, which takes far longer than reading a small file, so the files are spread over a
+ * few threads that each open, read and decrypt, keeping the disk and the CPU busy at the same time instead of
+ * waiting on one file after another. The calling thread loads files too, so there are never more than
+ * LOADER_THREADS key derivations at once, as each one takes a fair amount of memory. Files that still run out
+ * of memory are retried afterwards on their own. bodies[n] and status[n] are filled in for each filename */
+void load_entries(const char* file_path, char** filenames, const unsigned int count, const char* mast_pass, char** bodies, int* status) {
+  struct entry_loader loader = {file_path, filenames, mast_pass, bodies, status, count, 0, PTHREAD_MUTEX_INITIALIZER};
+  for (unsigned int n = 0; n < count; n++) {
+    bodies[n] = NULL;
+    status[n] = ENTRY_UNREADABLE;
+  }
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int workers = LOADER_THREADS;
+  if (cpus > 0 && (unsigned long)cpus < workers) {
+    workers = (unsigned int)cpus;
+  }
+  if (count < workers) {
+    workers = count;
+  }
+  pthread_t threads[LOADER_THREADS];
+  unsigned int started = 0;
+  /* The calling thread is one of the workers, so one thread fewer is started */
+  while (started + 1 < workers && pthread_create(&threads[started], NULL, load_entries_worker, &loader) == 0) {
+    started++;
+  }
+  /* If no thread could be started, everything is loaded right here */
+  load_entries_worker(&loader);
+  for (unsigned int n = 0; n < started; n++) {
+    pthread_join(threads[n], NULL);
+  }
+  pthread_mutex_destroy(&loader.lock);
+  /* A key derivation may have run out of memory only because the other threads were deriving keys as well,
+   * so those files are given another go, one at a time, now that nothing else is running */
+  for (unsigned int n = 0; n < count; n++) {
+    if (status[n] == ENTRY_NO_MEMORY) {
+      status[n] = load_entry(file_path, filenames[n], mast_pass, &bodies[n]);
+    }
+  }
+}
+
+/* Applying a script of add, update and rm operations to the vault in one go. Each line of the script is one
+ * operation, with fields separated by tabs,
+ *
+ *   add<TAB>title<TAB>password<TAB>username<TAB>url<TAB>notes
+ *   update<TAB>title<TAB>password<TAB>username<TAB>url<TAB>notes
+ *   rm<TAB>title
+ *
+ * Empty lines and lines starting with # are ignored. Every operation is applied to the index in memory first,
+ * so a bad script is rejected before anything on disk is touched. Then the new password files are written, the
+ * new index is written next to the old one and renamed over it, and only after that are password files which
+ * are no longer referenced deleted. The master password is asked for once, and the index is decrypted and
+ * encrypted once, no matter how many operations there are. */
+void batch_edit(const char* index_path, const char* file_path, const char* script_path) {
+  FILE* script_fp = fopen(script_path, "r");
+  if (! script_fp) {
+    fputs("Failed to open batch script. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
+  char mast_pass[PASS_LEN] = {0};
+  fputs("Master password: ", stdout);
+  password_input(mast_pass, PASS_LEN);
+  fputs("\n", stdout);
+
+  /* Reading the index, once */
+  size_t index_len = ((size_t)get_file_size(index_path) - SEAL_OVERHEAD)/sizeof(char);
+  char* index_buf = calloc(index_len + 1, sizeof(char));
+  if (! index_buf) {
+    fputs("Failed to allocate needed memory for reading index file. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
+  if (unseal_file(index_path, index_buf, index_len, mast_pass) != 0) {
+    fputs("Unable to decrypt index file. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
+  /* The index is rewritten from what split_index() finds, so anything it wouldn't find would be lost */
+  if (check_index(index_buf, index_len) != 0) {
+    fputs("The index file isn't in the expected format, so it has been left as it is. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
+  char** titles = NULL;
+  char** filenames = NULL;
+  unsigned int titles_cap = 0;
+  unsigned int filenames_cap = 0;
+  unsigned int entries = split_index(index_buf, &titles, &filenames, &titles_cap, &filenames_cap);
+  sodium_memzero(index_buf, index_len);
+  free(index_buf);
+
+  /* Password files to be written, and password files to be deleted once the new index is in place */
+  char** pending_names = NULL;
+  char** pending_bodies = NULL;
+  unsigned int pending = 0;
+  unsigned int names_cap = 0;
+  unsigned int bodies_cap = 0;
+  char** obsolete_names = NULL;
+  unsigned int obsolete = 0;
+  unsigned int obsolete_cap = 0;
+  unsigned int added = 0;
+  unsigned int updated = 0;
+  unsigned int removed = 0;
+
+  /* rand() only picks filenames here, so seeding it once is enough. Seeding it before every
+   * filename, as add_password() does, would hand out the same name over and over within a second */
+  srand(time(0));
+  char script_line[SCRIPT_LINE_LEN] = {0};
+  unsigned int line_no = 0;
+  while (fgets(script_line, SCRIPT_LINE_LEN, script_fp)) {
+    line_no++;
+    size_t line_len = strlen(script_line);
+    if (line_len == SCRIPT_LINE_LEN - 1 && script_line[line_len - 1] != '\n' && ! feof(script_fp)) {
+      fprintf(stdout, "Line %u of the batch script is too long. Aborting.\n", line_no);
+      exit(EXIT_FAILURE);
+    }
+    while (line_len > 0 && (script_line[line_len - 1] == '\n' || script_line[line_len - 1] == '\r')) {
+      script_line[--line_len] = '\0';
+    }
+    if (line_len == 0 || script_line[0] == '#') {
+      continue;
+    }
+    /* Splitting the line into fields, on tabs */
+    char* fields[6] = {0};
+    unsigned int nfields = 0;
+    char* field = script_line;
+    while (field && nfields < 6) {
+      fields[nfields++] = field;
+      field = strchr(field, '\t');
+      if (field) {
+        *field = '\0';
+        field++;
+      }
+    }
+    int is_add = strcmp(fields[0], "add") == 0;
+    int is_update = strcmp(fields[0], "update") == 0;
+    int is_rm = strcmp(fields[0], "rm") == 0;
+    if (! (is_add || is_update || is_rm) || field || nfields != (is_rm ? 2u : 6u)) {
+      fprintf(stdout, "Line %u of the batch script is not a valid operation. Aborting.\n", line_no);
+      exit(EXIT_FAILURE);
+    }
+    const char* title = fields[1];
+    if (strlen(title) == 0 || strlen(title) >= TITLE_LEN) {
+      fprintf(stdout, "Line %u of the batch script has an empty or too long title. Aborting.\n", line_no);
+      exit(EXIT_FAILURE);
+    }
+    /* Same limits as the ones add_password() reads with */
+    if (! is_rm && (strlen(fields[2]) >= PASS_LEN || strlen(fields[3]) >= 100 || strlen(fields[4]) >= 200 || strlen(fields[5]) >= 1000)) {
+      fprintf(stdout, "Line %u of the batch script has a field that is too long. Aborting.\n", line_no);
+      exit(EXIT_FAILURE);
+    }
+    int sel = find_str(titles, entries, title);
+    if (is_add && sel != -1) {
+      fprintf(stdout, "Line %u of the batch script adds an entry that already exists. Aborting.\n", line_no);
+      exit(EXIT_FAILURE);
+    }
+    if (! is_add && sel == -1) {
+      fprintf(stdout, "Line %u of the batch script refers to an entry that doesn't exist. Aborting.\n", line_no);
+      exit(EXIT_FAILURE);
+    }
+
+    if (! is_add) {
+      /* The entry's current file goes away. If it was written by this very batch, it just isn't written at all */
+      int p = find_str(pending_names, pending, filenames[sel]);
+      if (p != -1) {
+        free(pending_names[p]);
+        sodium_memzero(pending_bodies[p], strlen(pending_bodies[p]));
+        free(pending_bodies[p]);
+        pending--;
+        pending_names[p] = pending_names[pending];
+        pending_bodies[p] = pending_bodies[pending];
+      }
+      else {
+        obsolete_names = reserve_str_array(obsolete_names, obsolete, &obsolete_cap);
+        obsolete_names[obsolete++] = dup_str(filenames[sel]);
+      }
+    }
+    if (is_rm) {
+      free(titles[sel]);
+      free(filenames[sel]);
+      /* Shifting the rest down, so that the index keeps its order */
+      for (unsigned int n = sel; n + 1 < entries; n++) {
+        titles[n] = titles[n + 1];
+        filenames[n] = filenames[n + 1];
+      }
+      entries--;
+      removed++;
+      continue;
+    }
+    if (is_add) {
+      titles = reserve_str_array(titles, entries, &titles_cap);
+      filenames = reserve_str_array(filenames, entries, &filenames_cap);
+      sel = entries++;
+      titles[sel] = dup_str(title);
+      filenames[sel] = NULL;
+      added++;
+    }
+    else {
+      updated++;
+    }
+    /* Picking a filename nothing else uses, neither in the index, nor on disk */
+    char rand_str[RANDSTR_LEN] = {0};
+    char entry_path[PATH_LEN] = {0};
+    do {
+      rand_junk_str(rand_str, RANDSTR_LEN);
+      snprintf(entry_path, PATH_LEN, "%s%s", file_path, rand_str);
+    } while (find_str(filenames, entries, rand_str) != -1 || find_str(obsolete_names, obsolete, rand_str) != -1
+             || access(entry_path, F_OK) != -1);
+    free(filenames[sel]);
+    filenames[sel] = dup_str(rand_str);
+    size_t entry_len = 0;
+    char* entry = format_entry(title, fields[2], fields[3], fields[4], fields[5], &entry_len);
+    sodium_memzero(script_line, SCRIPT_LINE_LEN);
+    pending_names = reserve_str_array(pending_names, pending, &names_cap);
+    pending_bodies = reserve_str_array(pending_bodies, pending, &bodies_cap);
+    pending_names[pending] = dup_str(rand_str);
+    pending_bodies[pending] = entry;
+    pending++;
+  }
+  fclose(script_fp);
+
+  /* Nothing has been written yet. Now the new password files are sealed and flushed, one by one */
+  for (unsigned int n = 0; n < pending; n++) {
+    char entry_path[PATH_LEN] = {0};
+    snprintf(entry_path, PATH_LEN, "%s%s", file_path, pending_names[n]);
+    /* Sealed with the null byte at the end, as add_password() does */
+    if (seal_file(entry_path, pending_bodies[n], strlen(pending_bodies[n]) + 1, mast_pass, 1) != 0) {
+      fputs("Failed to write password file. Undoing batch and aborting.\n", stdout);
+      for (unsigned int m = 0; m <= n; m++) {
+        snprintf(entry_path, PATH_LEN, "%s%s", file_path, pending_names[m]);
+        remove(entry_path);
+      }
+      exit(EXIT_FAILURE);
+    }
+    sodium_memzero(pending_bodies[n], strlen(pending_bodies[n]));
+    free(pending_bodies[n]);
+  }
+  free(pending_bodies);
+
+  /* Building the new index, with one newline terminated line per entry */
+  size_t new_index_len = strlen(INDEX_HEADER);
+  for (unsigned int n = 0; n < entries; n++) {
+    new_index_len += strlen(filenames[n]) + strlen(titles[n]) + 2;
+  }
+  char* new_index = calloc(new_index_len + 1, sizeof(char));
+  if (! new_index) {
+    fputs("Failed to allocate needed memory for batch. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
+  size_t off = snprintf(new_index, new_index_len + 1, "%s", INDEX_HEADER);
+  for (unsigned int n = 0; n < entries; n++) {
+    off += snprintf(new_index + off, new_index_len + 1 - off, "%s,%s\n", filenames[n], titles[n]);
+    free(titles[n]);
+    free(filenames[n]);
+  }
+  free(titles);
+  free(filenames);
+
+  /* The new index is written beside the old one, flushed, and then renamed over it. rename() within a directory
+   * is atomic, so at any point there is either the old index or the new one, never a mix of both. The first
+   * directory sync makes every new password file and the new index durable together before they're published,
+   * the second one makes the publishing itself durable before any old password file is deleted. */
+  char tmp_index_path[PATH_LEN] = {0};
+  if (snprintf(tmp_index_path, PATH_LEN, "%s%s", index_path, ".tmp") >= PATH_LEN) {
+    fputs("Index file path is too long. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
+  if (seal_file(tmp_index_path, new_index, new_index_len, mast_pass, 1) != 0 || sync_dir(file_path) != 0
+      || rename(tmp_index_path, index_path) != 0) {
+    fputs("Failed to write index file. Undoing batch and aborting.\n", stdout);
+    remove(tmp_index_path);
+    for (unsigned int n = 0; n < pending; n++) {
+      char entry_path[PATH_LEN] = {0};
+      snprintf(entry_path, PATH_LEN, "%s%s", file_path, pending_names[n]);
+      remove(entry_path);
+    }
+    exit(EXIT_FAILURE);
+  }
+  sodium_memzero(new_index, new_index_len);
+  free(new_index);
+  sodium_memzero(mast_pass, sizeof(mast_pass));
+  if (sync_dir(file_path) != 0) {
+    fputs("Failed to flush password directory. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
+  for (unsigned int n = 0; n < pending; n++) free(pending_names[n]);
+  free(pending_names);
+
+  /* Old password files are no longer referenced by anything, so they can go now */
+  for (unsigned int n = 0; n < obsolete; n++) {
+    char entry_path[PATH_LEN] = {0};
+    snprintf(entry_path, PATH_LEN, "%s%s", file_path, obsolete_names[n]);
+    if (remove(entry_path) != 0) {
+      fputs("Failed to delete old password file ", stdout);
+      fputs(obsolete_names[n], stdout);
+      fputs(", it is no longer in the index.\n", stdout);
+    }
+    free(obsolete_names[n]);
+  }
+  free(obsolete_names);
+  fprintf(stdout, "Batch applied: %u added, %u updated, %u removed.\n", added, updated, removed);
+}
+
+/* Checking that every entry in the index points to a password file that exists and decrypts correctly */
+void verify_passwords(const char* index_path, const char* file_path) {
+  char mast_pass[PASS_LEN] = {0};
+  fputs("Master password: ", stdout);
+  password_input(mast_pass, PASS_LEN);
+  fputs("\n", stdout);
+
+  size_t index_len = ((size_t)get_file_size(index_path) - SEAL_OVERHEAD)/sizeof(char);
+  char* index_buf = calloc(index_len + 1, sizeof(char));
+  if (! index_buf) {
+    fputs("Failed to allocate needed memory for reading index file. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
+  if (unseal_file(index_path, index_buf, index_len, mast_pass) != 0) {
+    fputs("Unable to decrypt index file. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
+  /* An index that split_index() can't fully read would have its unread entries go unchecked */
+  if (check_index(index_buf, index_len) != 0) {
+    fputs("The index file isn't in the expected format, so its entries can't be verified. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
+  char** titles = NULL;
+  char** filenames = NULL;
+  unsigned int titles_cap = 0;
+  unsigned int filenames_cap = 0;
+  unsigned int entries = split_index(index_buf, &titles, &filenames, &titles_cap, &filenames_cap);
+  sodium_memzero(index_buf, index_len);
+  free(index_buf);
+  if (entries == 0) {
+    fputs("The index has no entries.\n", stdout);
+    sodium_memzero(mast_pass, sizeof(mast_pass));
+    return;
+  }
+
+  char** bodies = calloc(entries, sizeof(char*));
+  int* status = calloc(entries, sizeof(int));
+  if (! bodies || ! status) {
+    fputs("Failed to allocate needed memory for reading password files. Aborting.\n", stdout);
+    exit(EXIT_FAILURE);
+  }
+  load_entries(file_path, filenames, entries, mast_pass, bodies, status);
+  sodium_memzero(mast_pass, sizeof(mast_pass));
+
+  unsigned int bad = 0;
+  for (unsigned int n = 0; n < entries; n++) {
+    if (status[n] != ENTRY_OK) {
+      bad++;
+      fputs(titles[n], stdout);
+      if (status[n] == ENTRY_MISSING) {
+        fputs(": password file is missing.\n", stdout);
+      }
+      else if (status[n] == ENTRY_CORRUPTED) {
+        fputs(": password file has been forged or corrupted.\n", stdout);
+      }
+      else if (status[n] == ENTRY_NO_MEMORY) {
+        fputs(": ran out of memory while deriving key from master password.\n", stdout);
+      }
+      else {
+        fputs(": password file could not be read.\n", stdout);
+      }
+    }
+    if (bodies[n]) {
+      sodium_memzero(bodies[n], strlen(bodies[n]));
+      free(bodies[n]);
+    }
+    free(titles[n]);
+    free(filenames[n]);
+  }
+  free(bodies);
+  free(status);
+  free(titles);
+  free(filenames);
+  fprintf(stdout, "%u entries checked, %u with problems.\n", entries, bad);
+  if (bad) {
+    exit(EXIT_FAILURE);
+  }
+}
+
 int main(int argc, char *argv[]) {
   if (argc == 1) {
     /* This first case below executes when just the binary's name has been invoked.
@@ -619,6 +1289,8 @@ int main(int argc, char *argv[]) {
   int ls = ((strncmp(argv[1], "ls", 20) == 0) || (strncmp(argv[1], "list", 20) == 0) || (strncmp(argv[1], "show", 20) == 0)) ? 0 : 1;
   int rm = strncmp(argv[1], "rm", 20);
   int get = strncmp(argv[1], "get", 20);
+  int batch = strncmp(argv[1], "batch", 20);
+  int verify = strncmp(argv[1], "verify", 20);
   char home_path[100] = {0};
   char dir_path[200] = {0};
   char index_path[PATH_LEN] = {0};
@@ -651,6 +1323,13 @@ int main(int argc, char *argv[]) {
       check_folder_index(dir_path, index_path);
       get_password(index_path, file_path);
     }
+    else if (batch == 0) {
+      show_command_information(4);
+    }
+    else if (verify == 0) {
+      check_folder_index(dir_path, index_path);
+      verify_passwords(index_path, file_path);
+    }
     else {
       show_command_information(1);
     }
@@ -671,6 +1350,13 @@ int main(int argc, char *argv[]) {
     else if (get == 0) {
       show_command_information(2);
     }
+    else if (batch == 0) {
+      check_folder_index(dir_path, index_path);
+      batch_edit(index_path, file_path, argv[2]);
+    }
+    else if (verify == 0) {
+      show_command_information(2);
+    }
     else {
       show_command_information(1);
     }
@@ -0,0 +1,81 @@
+#!/bin/sh
+# Regression check for "citpass batch": entries added one at a time with "add" have to survive a batch run,
+# including one that changes nothing, and "citpass verify" has to find all of them intact. Usage: tests/batch.sh [path to citpass]
+citpass=${1:-./citpass}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+CITPASS_DIR="$tmp/vault"
+export CITPASS_DIR
+
+fail() {
+  echo "FAIL: $1"
+  exit 1
+}
+
+echo pw | "$citpass" init > /dev/null || fail "init"
+for title in mail bank forum; do
+  # Title, password, username, URL and notes, then the master password for the password file and the index
+  printf '%s\nsecret\nme\nhttps://example.org\nnotes\npw\npw\npw\n' "$title" | "$citpass" add > /dev/null || fail "add $title"
+done
+
+# An entry without a title is refused, rather than written into an index batch would then refuse to touch
+printf '\nsecret\nme\nhttps://example.org\nnotes\npw\npw\npw\n' | "$citpass" add > /dev/null && fail "add with an empty title"
+
+printf '# Nothing but a comment\n' > "$tmp/script"
+echo pw | "$citpass" batch "$tmp/script" || fail "batch with no operations"
+listing=$(echo pw | "$citpass" ls) || fail "ls after batch with no operations"
+for title in mail bank forum; do
+  echo "$listing" | grep -qx "$title" || fail "$title lost by a batch with no operations"
+done
+
+printf 'rm\tbank\nupdate\tmail\tnewsecret\tme\turl\tnotes\nadd\tshop\tsecret\tme\turl\tnotes\n' > "$tmp/script"
+echo pw | "$citpass" batch "$tmp/script" || fail "batch"
+listing=$(echo pw | "$citpass" ls) || fail "ls after batch"
+for title in mail forum shop; do
+  echo "$listing" | grep -qx "$title" || fail "$title missing after batch"
+done
+echo "$listing" | grep -qx bank && fail "bank still listed after batch"
+
+# A script that fails partway through changes nothing: the index stays byte for byte the same, and the
+# password file for the valid add before the failing line is never written
+printf 'add\tnew\tsecret\tme\turl\tnotes\nadd\tmail\tsecret\tme\turl\tnotes\n' > "$tmp/duplicate"
+printf 'add\tnew\tsecret\tme\turl\tnotes\nrm\tnothere\n' > "$tmp/missing"
+for script in duplicate missing; do
+  index_sum=$(cksum < "$CITPASS_DIR/index")
+  files=$(ls "$CITPASS_DIR")
+  echo pw | "$citpass" batch "$tmp/$script" > /dev/null && fail "batch with a $script entry succeeded"
+  [ "$(cksum < "$CITPASS_DIR/index")" = "$index_sum" ] || fail "batch with a $script entry changed the index"
+  [ "$(ls "$CITPASS_DIR")" = "$files" ] || fail "batch with a $script entry left files behind"
+done
+
+# Entries added and then updated or removed within the same script. Only the last version of temp2 gets a
+# password file, and temp never gets one at all
+printf 'add\ttemp\ts\tu\turl\tn\nadd\ttemp2\ts\tu\turl\tn\nupdate\ttemp\ts2\tu\turl\tn\nupdate\ttemp2\ts2\tu\turl\tn\nrm\ttemp\n' > "$tmp/script"
+echo pw | "$citpass" batch "$tmp/script" || fail "batch adding, updating and removing the same entries"
+listing=$(echo pw | "$citpass" ls) || fail "ls after batch on new entries"
+echo "$listing" | grep -qx temp && fail "temp still listed after being added and removed"
+echo "$listing" | grep -qx temp2 || fail "temp2 missing after being added and updated"
+# mail, forum, shop and temp2, plus the index
+[ "$(ls "$CITPASS_DIR" | wc -l)" -eq 5 ] || fail "batch on new entries left files behind"
+
+# Every entry left in the index has to point to a password file that decrypts
+echo pw | "$citpass" verify | grep -qx "4 entries checked, 0 with problems." || fail "verify after batch"
+
+# Adding an entry with "add" and printing the name of the password file it got
+add_entry() {
+  ls "$CITPASS_DIR" > "$tmp/before"
+  printf '%s\nsecret\nme\nhttps://example.org\nnotes\npw\npw\npw\n' "$1" | "$citpass" add > /dev/null || fail "add $1"
+  ls "$CITPASS_DIR" | comm -13 "$tmp/before" -
+}
+
+# verify has to point out entries whose password file is gone, or has been tampered with
+gone=$(add_entry gone)
+tampered=$(add_entry tampered)
+rm "$CITPASS_DIR/$gone"
+printf 'XXXX' | dd of="$CITPASS_DIR/$tampered" bs=1 seek=60 conv=notrunc 2> /dev/null
+result=$(echo pw | "$citpass" verify) && fail "verify succeeded on a broken vault"
+echo "$result" | grep -qx "gone: password file is missing." || fail "verify didn't report the missing password file"
+echo "$result" | grep -qx "tampered: password file has been forged or corrupted." || fail "verify didn't report the tampered password file"
+echo "$result" | grep -qx "6 entries checked, 2 with problems." || fail "verify reported the wrong number of problems"
+
+echo "PASS"